@@ -0,0 +1,216 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+#include <cmath>
+#include <cstring>
+#include <sys/utsname.h>
+
+#define BASELINE_SEP " # "
+
+/* Headless benchmark with a stored baseline:
+
+   clustarexamples --threads N --degree D [--duration MS]
+                   [--baseline FILE] [--threshold PCT] [--save]
+
+   With --save the run is written as the new baseline. Otherwise it is compared
+   op by op and the process exits with 1 when any op is both slower by more than
+   PCT percent and significantly slower under a one-sided Welch t-test
+   (alpha = 0.05). Exit code 2 means bad arguments, a missing or unreadable
+   baseline file, or mismatched parameters.
+*/
+
+struct baseline_data{
+    string fingerprint;
+    string parameters;
+    long long count = 0;
+    map<string, op_stats> stats;
+};
+
+static string machine_fingerprint(){
+    string cpu = "unknown";
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+    while (getline(cpuinfo, line)){
+        if (line.compare(0, 10, "model name") == 0){
+            cpu = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+    struct utsname name;
+    string kernel = uname(&name) == 0 ? string(name.sysname) + " " + name.release : "unknown";
+    string fingerprint = "cpu=" + cpu + "; cores=" + to_string(thread::hardware_concurrency()) + "; kernel=" + kernel;
+#ifdef __VERSION__
+    fingerprint += "; compiler=" + string(__VERSION__);
+#endif
+#ifdef SEAL_VERSION
+    fingerprint += "; seal=" + string(SEAL_VERSION);
+#endif
+    return fingerprint;
+}
+
+static void save_baseline(const string &path, const baseline_data &data){
+    ofstream out(path);
+    out << setprecision(17);
+    out << "fingerprint" << BASELINE_SEP << data.fingerprint << endl;
+    out << "parameters" << BASELINE_SEP << data.parameters << endl;
+    out << "count" << BASELINE_SEP << data.count << endl;
+    for (auto &op : data.stats){
+        out << "op" << BASELINE_SEP << op.first << BASELINE_SEP << op.second.n << BASELINE_SEP
+            << op.second.mean << BASELINE_SEP << op.second.m2 << endl;
+    }
+}
+
+/* Returns false with a message when the file is missing or a number in it
+   does not parse
+*/
+static bool load_baseline(const string &path, baseline_data &data){
+    ifstream in(path);
+    if (!in){
+        cout << "No baseline at " << path << ", run again with --save to create it" << endl;
+        return false;
+    }
+    string line;
+    int line_num = 0;
+    while (getline(in, line)){
+        line_num++;
+        vector<string> fields;
+        size_t start = 0, pos;
+        while ((pos = line.find(BASELINE_SEP, start)) != string::npos){
+            fields.push_back(line.substr(start, pos - start));
+            start = pos + strlen(BASELINE_SEP);
+        }
+        fields.push_back(line.substr(start));
+        try{
+            if (fields[0] == "fingerprint" && fields.size() == 2){
+                data.fingerprint = fields[1];
+            }else if (fields[0] == "parameters" && fields.size() == 2){
+                data.parameters = fields[1];
+            }else if (fields[0] == "count" && fields.size() == 2){
+                data.count = stoll(fields[1]);
+            }else if (fields[0] == "op" && fields.size() == 5){
+                op_stats &stats = data.stats[fields[1]];
+                stats.n = stoll(fields[2]);
+                stats.mean = stod(fields[3]);
+                stats.m2 = stod(fields[4]);
+            }
+        }catch (const logic_error &){
+            cout << "Corrupt baseline " << path << " at line " << line_num << ": " << line << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* One-sided 95% critical value of Student's t, Cornish-Fisher expansion
+*/
+static double t_critical(double df){
+    const double z = 1.6448536269514722;
+    return z + (z * z * z + z) / (4 * df)
+        + (5 * pow(z, 5) + 16 * pow(z, 3) + 3 * z) / (96 * df * df);
+}
+
+static int compare_baseline(const baseline_data &base, const baseline_data &run, double threshold){
+    if (base.fingerprint != run.fingerprint){
+        cout << "Warning: machine fingerprint differs from the baseline" << endl;
+        cout << "  baseline: " << base.fingerprint << endl;
+        cout << "  current : " << run.fingerprint << endl;
+    }
+    int regressions = 0;
+    fprintf(stdout, "+------------------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Operation                 | Base(us)     | Now(us)      | Delta(%%)  | t        | Status        |\n");
+    fprintf(stdout, "+------------------------------------------------------------------------------------------------+\n");
+    for (auto &op : run.stats){
+        auto it = base.stats.find(op.first);
+        if (it == base.stats.end()){
+            fprintf(stdout, "| %-25s | %-12s | %-12.3f | %-9s | %-8s | %-13s |\n",
+                op.first.c_str(), "-", op.second.mean, "-", "-", "new");
+            continue;
+        }
+        const op_stats &b = it->second, &r = op.second;
+        double delta = b.mean > 0 ? (r.mean - b.mean) / b.mean * 100 : 0;
+        string status = "ok";
+        char t_str[16] = "-";
+        if (b.n < 2 || r.n < 2){
+            status = delta > threshold ? "slower, n<2" : "ok, n<2";
+        }else{
+            double vb = b.variance() / b.n, vr = r.variance() / r.n;
+            double se = sqrt(vb + vr);
+            double t = se > 0 ? (r.mean - b.mean) / se : 0;
+            double df = (vb + vr) * (vb + vr) / (vb * vb / (b.n - 1) + vr * vr / (r.n - 1) + 1e-300);
+            snprintf(t_str, sizeof(t_str), "%.2f", t);
+            if (delta > threshold && t > t_critical(max(df, 1.0))){
+                status = "REGRESSION";
+                regressions++;
+            }else if (delta < -threshold && -t > t_critical(max(df, 1.0))){
+                status = "improved";
+            }
+        }
+        fprintf(stdout, "| %-25s | %-12.3f | %-12.3f | %-9.2f | %-8s | %-13s |\n",
+            op.first.c_str(), b.mean, r.mean, delta, t_str, status.c_str());
+    }
+    fprintf(stdout, "+------------------------------------------------------------------------------------------------+\n");
+    char threshold_str[16];
+    snprintf(threshold_str, sizeof(threshold_str), "%.2f%%", threshold);
+    fprintf(stdout, "| Iterations: baseline %-12lld now %-12lld threshold %-8s regressions %-12d |\n",
+        base.count, run.count, threshold_str, regressions);
+    fprintf(stdout, "+------------------------------------------------------------------------------------------------+\n");
+    return regressions > 0 ? 1 : 0;
+}
+
+int headless_runner(int argc, char** argv){
+    int cpu_core_num = 4;
+    size_t m_degree = 8192;
+    long long duration = 2000;
+    double threshold = 5;
+    bool save = false;
+    string path = "../clustar/baseline.txt";
+    vector<size_t> valid_degree = {1024, 2048, 4096, 8192, 16384, 32768};
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--threads" && has_value) cpu_core_num = atoi(argv[++i]);
+        else if (arg == "--degree" && has_value) m_degree = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--duration" && has_value) duration = atoll(argv[++i]);
+        else if (arg == "--baseline" && has_value) path = argv[++i];
+        else if (arg == "--threshold" && has_value) threshold = atof(argv[++i]);
+        else if (arg == "--save") save = true;
+        else{
+            cout << "Unknown argument " << arg << endl;
+            return 2;
+        }
+    }
+    if (cpu_core_num < 1 || cpu_core_num > 40 || duration <= 0 ||
+        find(valid_degree.begin(), valid_degree.end(), m_degree) == valid_degree.end()){
+        cout << "Invalid threads, poly_modulus_degree or duration" << endl;
+        return 2;
+    }
+
+    baseline_data run;
+    run.fingerprint = machine_fingerprint();
+    run.parameters = "threads=" + to_string(cpu_core_num) + " poly_modulus_degree=" + to_string(m_degree)
+        + " duration_ms=" + to_string(duration);
+
+    /*Validate the baseline before spending a whole run on it
+    */
+    baseline_data base;
+    if (!save){
+        if (!load_baseline(path, base)){
+            return 2;
+        }
+        if (base.parameters != run.parameters){
+            cout << "Baseline parameters (" << base.parameters << ") do not match this run ("
+                << run.parameters << ")" << endl;
+            return 2;
+        }
+    }
+    run_bfv_threads(cpu_core_num, m_degree, duration * 1000, run.stats, run.count);
+
+    if (save){
+        save_baseline(path, run);
+        cout << "Baseline saved to " << path << endl;
+        return 0;
+    }
+    return compare_baseline(base, run, threshold);
+}
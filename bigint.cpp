@@ -0,0 +1,308 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+
+/* Each value is split across batching primes of CRT_PRIME_BITS bits. Batching
+   primes sit just below their bit bound, so the product P satisfies
+   2^127 < P < 2^128: every int64 x int64 product lies inside the centered range
+   (-P/2, P/2] and the reconstruction still fits in an unsigned __int128. A
+   fresh ciphertext at 4096 has about 39 bits of noise budget and a multiply
+   with a 26-bit plain modulus costs about 38, so CRT_MIN_DEGREE is 8192.
+*/
+#define CRT_PRIME_BITS {26, 26, 26, 25, 25}
+#define CRT_BASELINE_BITS 60
+#define CRT_MIN_DEGREE 8192
+
+static string int128_to_string(__int128 value){
+    if (value == 0) return "0";
+    bool negative = value < 0;
+    unsigned __int128 mag = negative ? -(unsigned __int128)value : (unsigned __int128)value;
+    string str;
+    while (mag > 0){
+        str.push_back('0' + (int)(mag % 10));
+        mag /= 10;
+    }
+    if (negative) str.push_back('-');
+    reverse(str.begin(), str.end());
+    return str;
+}
+
+static uint64_t crt_residue(long long value, uint64_t modulus){
+    long long res = value % (long long)modulus;
+    if (res < 0) res += (long long)modulus;
+    return (uint64_t)res;
+}
+
+static uint64_t crt_inverse(uint64_t value, uint64_t modulus){
+    /* Extended Euclid, moduli are distinct primes so the inverse exists
+    */
+    long long t = 0, new_t = 1;
+    long long r = (long long)modulus, new_r = (long long)(value % modulus);
+    while (new_r != 0){
+        long long q = r / new_r;
+        long long tmp = t - q * new_t; t = new_t; new_t = tmp;
+        tmp = r - q * new_r; r = new_r; new_r = tmp;
+    }
+    if (t < 0) t += (long long)modulus;
+    return (uint64_t)t;
+}
+
+/* Garner's algorithm: rebuild x mod (p_0 * ... * p_{k-1}) in mixed radix form
+   and return it in the centered range (-P/2, P/2].
+*/
+static __int128 crt_reconstruct(const vector<uint64_t> &residues, const vector<SmallModulus> &moduli){
+    size_t k = moduli.size();
+    vector<uint64_t> digits(k);
+    for (size_t i = 0; i < k; i++){
+        uint64_t p = moduli[i].value();
+        unsigned __int128 acc = 0, radix = 1;
+        for (size_t j = 0; j < i; j++){
+            acc = (acc + (unsigned __int128)(digits[j] % p) * (uint64_t)(radix % p)) % p;
+            radix = (radix % p) * (moduli[j].value() % p) % p;
+        }
+        uint64_t diff = (residues[i] + p - (uint64_t)acc) % p;
+        digits[i] = (uint64_t)((unsigned __int128)diff * crt_inverse((uint64_t)radix, p) % p);
+    }
+    unsigned __int128 value = 0, radix = 1, product = 1;
+    for (size_t i = 0; i < k; i++){
+        value += radix * digits[i];
+        radix *= moduli[i].value();
+    }
+    product = radix;
+    if (value > product / 2){
+        return -(__int128)(product - value);
+    }
+    return (__int128)value;
+}
+
+void* crt_worker(void *th_para){
+    struct crt_para *para = (struct crt_para *) th_para;
+    chrono::high_resolution_clock::time_point time_start, time_end;
+    auto context = para->context;
+    uint64_t modulus = context->key_context_data()->parms().plain_modulus().value();
+
+    time_start = chrono::high_resolution_clock::now();
+    KeyGenerator keygen(context);
+    PublicKey public_key = keygen.public_key();
+    SecretKey secret_key = keygen.secret_key();
+    RelinKeys relin_keys;
+    if (context->using_keyswitching()){
+        relin_keys = keygen.relin_keys();
+    }
+    time_end = chrono::high_resolution_clock::now();
+    para->key_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+
+    Encryptor encryptor(context, public_key);
+    Evaluator evaluator(context);
+    Decryptor decryptor(context, secret_key);
+    BatchEncoder batch_encoder(context);
+    size_t slot_count = batch_encoder.slot_count();
+
+    /*Every slot carries the same residue, only slot 0 is read back
+    */
+    Plaintext x_plain_1, x_plain_2;
+    batch_encoder.encode(vector<uint64_t>(slot_count, crt_residue(para->num1, modulus)), x_plain_1);
+    batch_encoder.encode(vector<uint64_t>(slot_count, crt_residue(para->num2, modulus)), x_plain_2);
+    Ciphertext x_encrypted_1, x_encrypted_2;
+    time_start = chrono::high_resolution_clock::now();
+    encryptor.encrypt(x_plain_1, x_encrypted_1);
+    if (para->op != 3){
+        encryptor.encrypt(x_plain_2, x_encrypted_2);
+    }
+    time_end = chrono::high_resolution_clock::now();
+    para->en_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+
+    time_start = chrono::high_resolution_clock::now();
+    switch(para->op){
+        case 1: evaluator.add_inplace(x_encrypted_1, x_encrypted_2); break;
+        case 2: evaluator.multiply_inplace(x_encrypted_1, x_encrypted_2); break;
+        case 3: evaluator.square_inplace(x_encrypted_1); break;
+        default: break;
+    }
+    time_end = chrono::high_resolution_clock::now();
+    para->op_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+
+    para->re_time = 0;
+    if (para->op != 1 && context->using_keyswitching()){
+        time_start = chrono::high_resolution_clock::now();
+        evaluator.relinearize_inplace(x_encrypted_1, relin_keys);
+        time_end = chrono::high_resolution_clock::now();
+        para->re_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+    }
+    para->noise = decryptor.invariant_noise_budget(x_encrypted_1);
+
+    Plaintext res_plain;
+    vector<uint64_t> res_vector(slot_count);
+    time_start = chrono::high_resolution_clock::now();
+    decryptor.decrypt(x_encrypted_1, res_plain);
+    batch_encoder.decode(res_plain, res_vector);
+    time_end = chrono::high_resolution_clock::now();
+    para->de_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+    para->res = res_vector[0];
+    return NULL;
+}
+
+static void print_bigint_result(const crt_para &sample, const vector<SmallModulus> &moduli, const vector<crt_para> &crt_res, __int128 crt_value, __int128 expected, bool overflow, size_t crt_wall, const crt_para &base_res, __int128 base_value, size_t base_wall){
+    string op_name;
+    switch(sample.op){
+        case 1: op_name = "Add"; break;
+        case 2: op_name = "Mul"; break;
+        case 3: op_name = "Square"; break;
+        default: op_name = "Unknown"; break;
+    }
+    string moduli_str;
+    for (size_t i = 0; i < moduli.size(); i++){
+        moduli_str += (i ? ", " : "") + to_string(moduli[i].value());
+    }
+    size_t key_max = 0, en_max = 0, op_max = 0, re_max = 0, de_max = 0, noise_min = numeric_limits<size_t>::max();
+    for (auto &res : crt_res){
+        key_max = max(key_max, res.key_time);
+        en_max = max(en_max, res.en_time);
+        op_max = max(op_max, res.op_time);
+        re_max = max(re_max, res.re_time);
+        de_max = max(de_max, res.de_time);
+        noise_min = min(noise_min, res.noise);
+    }
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "|                                  BIG INTEGER RESULT                                    |\n");
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Task Type                   | %-56s |\n", op_name.c_str());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Number 1                    | %-56lld |\n", sample.num1);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    if (sample.op != 3){
+        fprintf(stdout, "| Number 2                    | %-56lld |\n", sample.num2);
+        fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    }
+    fprintf(stdout, "| Expected                    | %-56s |\n", int128_to_string(expected).c_str());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "|                                                                                        |\n");
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| CRT Mode (%-2lu plain moduli of 25 ~ 26 bits, one thread per modulus)                     |\n", moduli.size());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Plain_moduli                | %-56s |\n", moduli_str.c_str());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Key Generation Time (max)   | %-56lu |\n", key_max);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Encryption Time (max)       | %-56lu |\n", en_max);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Operation Time (max)        | %-56lu |\n", op_max);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Relinearize Time (max)      | %-56lu |\n", re_max);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Decryption Time (max)       | %-56lu |\n", de_max);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Wall Time                   | %-56lu |\n", crt_wall);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Noise_budget (min)          | %-56lu |\n", noise_min);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Output                      | %-56s |\n", int128_to_string(crt_value).c_str());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Correct                     | %-56s |\n", overflow ? "Overflow" : ((crt_value == expected && noise_min > 0) ? "Yes" : "No"));
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "|                                                                                        |\n");
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Single Modulus (%d-bit plain modulus)                                                   |\n", CRT_BASELINE_BITS);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Plain_modulus               | %-56lu |\n", base_res.context->key_context_data()->parms().plain_modulus().value());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Key Generation Time         | %-56lu |\n", base_res.key_time);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Encryption Time             | %-56lu |\n", base_res.en_time);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Operation Time              | %-56lu |\n", base_res.op_time);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Relinearize Time            | %-56lu |\n", base_res.re_time);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Decryption Time             | %-56lu |\n", base_res.de_time);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Wall Time                   | %-56lu |\n", base_wall);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Noise_budget                | %-56lu |\n", base_res.noise);
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Output                      | %-56s |\n", int128_to_string(base_value).c_str());
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Correct                     | %-56s |\n", (base_value == expected && base_res.noise > 0) ? "Yes" : "No");
+    fprintf(stdout, "+----------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "\n");
+}
+
+/* Builds its own contexts, the calculator only passes its poly_modulus_degree
+*/
+void bigint_helper(size_t poly_modulus_degree){
+    long long num1, num2 = 0;
+    int sub_op;
+    if (poly_modulus_degree < CRT_MIN_DEGREE){
+        cout << "Big Integer mode needs poly_modulus_degree >= " << CRT_MIN_DEGREE << endl;
+        return;
+    }
+    cout << endl << ">Enter Big Integer Operation 1 (Add), 2 (Mul), 3 (Square):";
+    while (!(cin >> sub_op) || (sub_op < 1 || sub_op > 3));
+    cout << endl << ">Enter Number:";
+    while (!(cin >> num1));
+    if (sub_op != 3){
+        cout << endl << ">Enter Number:";
+        while (!(cin >> num2));
+    }
+    __int128 expected;
+    switch(sub_op){
+        case 1: expected = (__int128)num1 + num2; break;
+        case 2: expected = (__int128)num1 * num2; break;
+        default: expected = (__int128)num1 * num1; break;
+    }
+
+    /*One context per coprime batching prime
+    */
+    vector<SmallModulus> moduli = PlainModulus::Batching(poly_modulus_degree, vector<int>CRT_PRIME_BITS);
+    vector<crt_para> crt_res(moduli.size());
+    pthread_t thread[moduli.size()];
+    for (size_t i = 0; i < moduli.size(); i++){
+        EncryptionParameters parms(scheme_type::BFV);
+        parms.set_poly_modulus_degree(poly_modulus_degree);
+        parms.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
+        parms.set_plain_modulus(moduli[i]);
+        crt_res[i].op = sub_op;
+        crt_res[i].num1 = num1;
+        crt_res[i].num2 = sub_op == 3 ? num1 : num2;
+        crt_res[i].context = SEALContext::Create(parms);
+    }
+    unsigned __int128 product = 1;
+    for (auto &modulus : moduli) product *= modulus.value();
+    __int128 bound = (__int128)(product / 2);
+    bool overflow = expected > bound || expected < -bound;
+
+    chrono::high_resolution_clock::time_point time_start, time_end;
+    time_start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < moduli.size(); i++){
+        pthread_create(&thread[i], NULL, crt_worker, (void*)(&crt_res[i]));
+    }
+    for (size_t i = 0; i < moduli.size(); i++){
+        pthread_join(thread[i], NULL);
+    }
+    vector<uint64_t> residues(moduli.size());
+    for (size_t i = 0; i < moduli.size(); i++){
+        residues[i] = crt_res[i].res;
+    }
+    __int128 crt_value = crt_reconstruct(residues, moduli);
+    time_end = chrono::high_resolution_clock::now();
+    size_t crt_wall = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+
+    /*Baseline: the same task with one context and the largest batching plain modulus
+    */
+    EncryptionParameters parms(scheme_type::BFV);
+    parms.set_poly_modulus_degree(poly_modulus_degree);
+    parms.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
+    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, CRT_BASELINE_BITS));
+    crt_para base_res = crt_res[0];
+    base_res.context = SEALContext::Create(parms);
+    time_start = chrono::high_resolution_clock::now();
+    crt_worker((void*)(&base_res));
+    time_end = chrono::high_resolution_clock::now();
+    size_t base_wall = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+    uint64_t base_modulus = base_res.context->key_context_data()->parms().plain_modulus().value();
+    __int128 base_value = base_res.res > base_modulus / 2 ? -(__int128)(base_modulus - base_res.res) : (__int128)base_res.res;
+
+    print_bigint_result(crt_res[0], moduli, crt_res, crt_value, expected, overflow, crt_wall, base_res, base_value, base_wall);
+}
@@ -8,6 +8,10 @@ int main(int argc, char** argv){
 #ifdef SEAL_VERSION
     cout << "Microsoft SEAL version: " << SEAL_VERSION << endl;
 #endif
+    trace_init();
+    if (argc > 1){
+        return headless_runner(argc, argv);
+    }
     /* Main Page
     */
     bool invalid = true;
@@ -15,11 +19,13 @@ int main(int argc, char** argv){
         system("clear");
         cout << nation_flag;
         int op = 1;
-        cout << endl << ">Enter Task Mode (1 ~ 2) or exit (0):";
+        cout << endl << ">Enter Task Mode (1 ~ 4) or exit (0):";
         while (!(cin >> op));
         switch(op){
             case 1: calc_bfv_basic(); break;
             case 2: muti_core_runner(); break;
+            case 3: poly_runner(); break;
+            case 4: keygen_runner(); break;
             case 0:  invalid = false; break;
             default: cout << "Unknown Mode!!!\n" << endl; invalid = false; break;
         }
@@ -21,6 +21,7 @@ void calc_bfv_basic(){
         cout << "| 1. Add Plain               | Operation: 1（Add）        |" << endl;
         cout << "| 2. Multiply                | Enter Number: 24           |" << endl;
         cout << "| 3. Square                  | Enter Number: 12           |" << endl;
+        cout << "| 4. Big Integer (CRT)       | Degree >= 8192             |" << endl;
         cout << "+----------------------------+----------------------------+" << endl;
         cout << endl << ">Enter poly_modulus_degree 2048, 4096, 8192, 16384 32768 or exit (0):";
         while (!(cin >> poly_modulus_degree));
@@ -34,12 +35,13 @@ void calc_bfv_basic(){
         parms.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
         parms.set_plain_modulus(1024);
         auto context = SEALContext::Create(parms);
-        cout << endl << ">Enter Operation (1 ~ 3):";
-        while (!(cin>>op) || ((op < 0 || op > 3)));
+        cout << endl << ">Enter Operation (1 ~ 4):";
+        while (!(cin>>op) || ((op < 0 || op > 4)));
         switch(op){
             case 1: add_plain_helper(op, context); break;
             case 2: mul_helper(op, context); break;
             case 3: square_helper(op, context); break;
+            case 4: bigint_helper(poly_modulus_degree); break;
             default: break;
         }
     }while(invalid);//end for while
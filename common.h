@@ -14,19 +14,105 @@
 #include <memory>
 #include <limits>
 #include <algorithm>
+#include <map>
+#include <set>
 #include <numeric>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include "seal/seal.h"
 
 using namespace std;
 using namespace seal;
 
+/* Running mean and variance of one operation (Welford), merged across threads
+*/
+struct op_stats{
+    long long n = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double x){
+        n++;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+
+    void merge(const op_stats &other){
+        if (other.n == 0) return;
+        long long total = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta * other.n / total;
+        m2 += other.m2 + delta * delta * n * other.n / total;
+        n = total;
+    }
+
+    double variance() const{
+        return n > 1 ? m2 / (n - 1) : 0;
+    }
+};
+
+/* Operations timed by the multicore benchmark. The per-thread statistics are a
+   fixed array indexed by these, so recording a sample never allocates.
+*/
+enum bench_op{
+    BENCH_KEYGEN,
+    BENCH_RELIN_KEYS,
+    BENCH_GALOIS_KEYS,
+    BENCH_BATCH,
+    BENCH_UNBATCH,
+    BENCH_ENCRYPT,
+    BENCH_EXCHANGE,
+    BENCH_DECRYPT,
+    BENCH_ADD,
+    BENCH_MULTIPLY,
+    BENCH_MULTIPLY_PLAIN,
+    BENCH_SQUARE,
+    BENCH_RELINEARIZE,
+    BENCH_ROTATE_ROWS_ONE_STEP,
+    BENCH_ROTATE_ROWS_RANDOM,
+    BENCH_ROTATE_COLUMNS,
+    BENCH_OP_NUM
+};
+
+static const char *const bench_op_names[BENCH_OP_NUM] = {
+    "keygen", "relin_keys", "galois_keys", "batch", "unbatch", "encrypt", "exchange", "decrypt",
+    "add", "multiply", "multiply_plain", "square", "relinearize",
+    "rotate_rows_one_step", "rotate_rows_random", "rotate_columns"
+};
+
+struct shard_link;
+
 struct thread_para{
     int fd;
     shared_ptr<SEALContext> context;
+    long long duration;
+    long long count;
+    op_stats stats[BENCH_OP_NUM];
+    long long loop_time;
+    long long pss;
+    struct shard_link *link;
+};
+
+/* Per-run figures of run_bfv_threads next to the merged statistics
+*/
+struct bench_summary{
+    long long setup_time;
+    long long pss;
+    double rate;
+};
+
+struct crt_para{
+    int op;
+    long long num1;
+    long long num2;
+    shared_ptr<SEALContext> context;
+    uint64_t res;
+    size_t noise;
+    size_t key_time, en_time, op_time, re_time, de_time;
 };
 
 #define nation_flag "\
@@ -42,8 +128,23 @@ struct thread_para{
 inline void add_plain_helper(int op, shared_ptr<SEALContext> context);
 inline void mul_helper(int op, shared_ptr<SEALContext> context);
 inline void square_helper(int op, shared_ptr<SEALContext> context);
+void bigint_helper(size_t poly_modulus_degree);
 void calc_bfv_basic();
 int muti_core_runner();
+EncryptionParameters bfv_parameters(size_t m_degree);
+void bfv_op_loop(struct thread_para *para, ofstream &LogVVV, const PublicKey &public_key, const SecretKey &secret_key, const RelinKeys &relin_keys, const GaloisKeys &gal_keys);
+void run_bfv_threads(int cpu_core_num, size_t m_degree, long long duration, map<string, op_stats> &stats, long long &count, struct bench_summary *summary = NULL);
+void shard_exchange(struct shard_link *link, const Ciphertext &encrypted, const Evaluator &evaluator);
+void shard_runner(int cpu_core_num, size_t m_degree, long long duration, bool compare);
+int headless_runner(int argc, char** argv);
+int poly_runner();
+int keygen_runner();
+vector<int> default_galois_steps(shared_ptr<SEALContext> context);
+void trace_init();
+void trace_thread_name(const string &label);
+void trace_record(const char *name, chrono::high_resolution_clock::time_point time_start, chrono::high_resolution_clock::time_point time_end);
+void trace_dump(const string &suffix = "");
+void parallel_keygen(shared_ptr<SEALContext> context, const SecretKey &secret_key, const PublicKey &public_key, int thread_num, RelinKeys &relin_keys, GaloisKeys &gal_keys);
 
 /*
 Helper function: Prints the name of the example in a fancy banner.
@@ -0,0 +1,195 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+
+/* One task is the relinearization key or the Galois key of one rotation step.
+   Every task gets its own KeyGenerator built from the shared secret key, so the
+   tasks are independent and the workers only synchronize on the task index.
+*/
+struct keygen_pool{
+    shared_ptr<SEALContext> context;
+    const SecretKey *secret_key;
+    const PublicKey *public_key;
+    vector<int> steps;
+    vector<GaloisKeys> galois;
+    RelinKeys relin;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+void* keygen_worker(void *th_para){
+    struct keygen_pool *pool = (struct keygen_pool *) th_para;
+    chrono::high_resolution_clock::time_point time_start, time_end;
+    trace_thread_name("keygen worker");
+    while (1){
+        pthread_mutex_lock(&pool->lock);
+        size_t task = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (task > pool->steps.size()) break;
+        time_start = chrono::high_resolution_clock::now();
+        KeyGenerator keygen(pool->context, *pool->secret_key, *pool->public_key);
+        if (task == pool->steps.size()){
+            pool->relin = keygen.relin_keys();
+        }else{
+            pool->galois[task] = keygen.galois_keys(vector<int>{pool->steps[task]});
+        }
+        time_end = chrono::high_resolution_clock::now();
+        trace_record(task == pool->steps.size() ? "relin_keys" : "galois_key", time_start, time_end);
+    }
+    return NULL;
+}
+
+/* Same rotations as KeyGenerator::galois_keys(): the column swap (step 0) and
+   the row rotations by every power of two in both directions.
+*/
+vector<int> default_galois_steps(shared_ptr<SEALContext> context){
+    vector<int> steps = {0};
+    int row_size = context->key_context_data()->parms().poly_modulus_degree() / 2;
+    for (int step = 1; step < row_size; step <<= 1){
+        steps.push_back(step);
+        steps.push_back(-step);
+    }
+    return steps;
+}
+
+void parallel_keygen(shared_ptr<SEALContext> context, const SecretKey &secret_key, const PublicKey &public_key, int thread_num, RelinKeys &relin_keys, GaloisKeys &gal_keys){
+    if (!context->using_keyswitching()){
+        throw invalid_argument("encryption parameters do not support keyswitching");
+    }
+    struct keygen_pool pool;
+    pool.context = context;
+    pool.secret_key = &secret_key;
+    pool.public_key = &public_key;
+    pool.steps = default_galois_steps(context);
+    pool.galois.resize(pool.steps.size());
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    pthread_t thread[thread_num];
+    for (int i = 0; i < thread_num; i ++){
+        pthread_create(&thread[i], NULL, keygen_worker, (void*)(&pool));
+    }
+    for (int i = 0; i < thread_num; i ++){
+        pthread_join(thread[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+
+    /* Merge the single-step keys, each one only fills its own Galois index
+    */
+    gal_keys = GaloisKeys();
+    for (auto &partial : pool.galois){
+        auto &data = partial.data();
+        if (gal_keys.data().size() < data.size()){
+            gal_keys.data().resize(data.size());
+        }
+        for (size_t i = 0; i < data.size(); i++){
+            if (!data[i].empty()){
+                gal_keys.data()[i] = move(data[i]);
+            }
+        }
+        gal_keys.parms_id() = partial.parms_id();
+    }
+    relin_keys = move(pool.relin);
+}
+
+/* Rotate once by a row step and once by columns with the merged keys
+*/
+static bool check_galois_keys(shared_ptr<SEALContext> context, const PublicKey &public_key, const SecretKey &secret_key, const GaloisKeys &gal_keys){
+    Encryptor encryptor(context, public_key);
+    Decryptor decryptor(context, secret_key);
+    Evaluator evaluator(context);
+    BatchEncoder batch_encoder(context);
+    size_t slot_count = batch_encoder.slot_count();
+    size_t row_size = slot_count / 2;
+    vector<uint64_t> pod_vector(slot_count), expected(slot_count), res_vector(slot_count);
+    for (size_t i = 0; i < slot_count; i++){
+        pod_vector[i] = i;
+    }
+    for (size_t r = 0; r < 2; r++){
+        for (size_t c = 0; c < row_size; c++){
+            expected[(1 - r) * row_size + c] = pod_vector[r * row_size + (c + 1) % row_size];
+        }
+    }
+    Plaintext plain;
+    batch_encoder.encode(pod_vector, plain);
+    Ciphertext encrypted;
+    encryptor.encrypt(plain, encrypted);
+    evaluator.rotate_rows_inplace(encrypted, 1, gal_keys);
+    evaluator.rotate_columns_inplace(encrypted, gal_keys);
+    decryptor.decrypt(encrypted, plain);
+    batch_encoder.decode(plain, res_vector);
+    return res_vector == expected;
+}
+
+int keygen_runner(){
+    bool invalid = true;
+    int max_threads = 40;
+    size_t m_degree = 8192;
+    vector<int> valid_degree = {4096, 8192, 16384, 32768};
+    do{
+        cout << "+---------------------------------------------------------+" << endl;
+        cout << "| Parallel Key Generation                                 |" << endl;
+        cout << "+---------------------------------------------------------+" << endl;
+        cout << endl << ">Enter Max Number of Threads (1 ~ 40) or exit (0):";
+        while (!(cin >> max_threads) || (max_threads < 0 || max_threads > 40));
+        if (max_threads == 0){invalid = false; continue;}
+        cout << endl << ">Enter poly_modulus_degree 4096, 8192, 16384 or 32768:";
+        while (!(cin >> m_degree));
+        if (find(valid_degree.begin(), valid_degree.end(), m_degree) == valid_degree.end()){
+            cout << "Invalid poly_modulus_degree" << endl;
+            invalid = false;
+            continue;
+        }
+        EncryptionParameters parms(scheme_type::BFV);
+        parms.set_poly_modulus_degree(m_degree);
+        parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_degree));
+        parms.set_plain_modulus(PlainModulus::Batching(m_degree, 20));
+        auto context = SEALContext::Create(parms);
+        chrono::high_resolution_clock::time_point time_start, time_end;
+
+        KeyGenerator keygen(context);
+        SecretKey secret_key = keygen.secret_key();
+        PublicKey public_key = keygen.public_key();
+
+        /*Serial reference, the way every bfv_performance thread does it
+        */
+        time_start = chrono::high_resolution_clock::now();
+        RelinKeys relin_keys = keygen.relin_keys();
+        GaloisKeys gal_keys = keygen.galois_keys();
+        time_end = chrono::high_resolution_clock::now();
+        trace_record("serial_keygen", time_start, time_end);
+        size_t serial_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+
+        vector<int> thread_counts;
+        for (int t = 1; t < max_threads; t <<= 1) thread_counts.push_back(t);
+        thread_counts.push_back(max_threads);
+
+        fprintf(stdout, "+---------------------------------------------------------+\n");
+        fprintf(stdout, "| poly_modulus_degree %-6lu  Galois steps %-3lu            |\n", m_degree, default_galois_steps(context).size());
+        fprintf(stdout, "+---------------------------------------------------------+\n");
+        fprintf(stdout, "| Threads    | Wall Time(us)        | Speedup             |\n");
+        fprintf(stdout, "+---------------------------------------------------------+\n");
+        fprintf(stdout, "| %-10s | %-20lu | %-19.2f |\n", "serial", serial_time, 1.0);
+        fprintf(stdout, "+---------------------------------------------------------+\n");
+        bool correct = true;
+        for (int t : thread_counts){
+            time_start = chrono::high_resolution_clock::now();
+            parallel_keygen(context, secret_key, public_key, t, relin_keys, gal_keys);
+            time_end = chrono::high_resolution_clock::now();
+            trace_record("parallel_keygen", time_start, time_end);
+            size_t wall_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+            fprintf(stdout, "| %-10d | %-20lu | %-19.2f |\n", t, wall_time, (double)serial_time / max<size_t>(wall_time, 1));
+            fprintf(stdout, "+---------------------------------------------------------+\n");
+            if (t == max_threads){
+                correct = check_galois_keys(context, public_key, secret_key, gal_keys);
+            }
+        }
+        fprintf(stdout, "| Rotation check with merged keys: %-22s |\n", correct ? "Pass" : "Fail");
+        fprintf(stdout, "+---------------------------------------------------------+\n");
+        fprintf(stdout, "\n");
+        trace_dump();
+    }while (invalid);
+    return 0;
+}
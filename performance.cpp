@@ -5,51 +5,39 @@
 
 #define MAXS 18000 //running for 3 minutes
 
-void* bfv_performance(void *th_para){
-    /* Get the current timestamp
-    */
-    struct thread_para *para = (struct thread_para *) th_para;
-    string path = "../clustar/record/log";
-    path = path + to_string(para->fd);
-    ofstream LogVVV(path);
+/* Every timed operation feeds the per-op statistics and the optional tracer
+*/
+static inline void bench_record(struct thread_para *para, bench_op op, chrono::high_resolution_clock::time_point time_start, chrono::high_resolution_clock::time_point time_end){
+    para->stats[op].add(chrono::duration<double, micro>(time_end - time_start).count());
+    trace_record(bench_op_names[op], time_start, time_end);
+}
+
+/* Proportional set size of this process in kB, shared pages are divided among
+   the processes that map them. 0 when /proc/self/smaps_rollup is unavailable.
+*/
+static long long pss_kb(){
+    ifstream smaps("/proc/self/smaps_rollup");
+    string line;
+    while (getline(smaps, line)){
+        if (line.compare(0, 4, "Pss:") == 0){
+            return atoll(line.c_str() + 4);
+        }
+    }
+    return 0;
+}
+
+/* The timed operation loop, shared by the threaded and the multi-process runner.
+   Runs for at least para->duration microseconds with the given keys, the clock
+   is only checked after a full iteration so para->loop_time holds the time it
+   actually ran. Samples the process PSS into para->pss while the keys are
+   still alive.
+*/
+void bfv_op_loop(struct thread_para *para, ofstream &LogVVV, const PublicKey &public_key, const SecretKey &secret_key, const RelinKeys &relin_keys, const GaloisKeys &gal_keys){
     chrono::high_resolution_clock::time_point time_start, time_end;
-    chrono::microseconds time_diff;
     auto context = para->context;
     auto &parms = context->first_context_data()->parms();
     auto &plain_modulus = parms.plain_modulus();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
-    /* Generating secret/public keys
-    */
-    time_start = chrono::high_resolution_clock::now();
-    KeyGenerator keygen(context);
-    time_end = chrono::high_resolution_clock::now();
-    time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
-    LogVVV << "Generate Keys Done: " << time_diff.count() << " microseconds" << endl;
-    auto secret_key = keygen.secret_key();
-    auto public_key = keygen.public_key();
-    RelinKeys relin_keys;
-    GaloisKeys gal_keys;
-    if (context->using_keyswitching()){
-        /* Generate relinearization keys
-        */
-        time_start = chrono::high_resolution_clock::now();
-        relin_keys = keygen.relin_keys();
-        time_end = chrono::high_resolution_clock::now();
-        time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
-        LogVVV << "Generate Relinearization Keys Done: " << time_diff.count() << " microseconds" << endl;
-        if (!context->key_context_data()->qualifiers().using_batching){
-            LogVVV << "Given encryption parameters do not support batching." << endl;
-            return NULL;
-        }
-        /* Generating Galois keys
-        */
-        time_start = chrono::high_resolution_clock::now();
-        gal_keys = keygen.galois_keys();
-        time_end = chrono::high_resolution_clock::now();
-        time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
-        LogVVV << "Generating Galois Key Done: " << time_diff.count() << " microseconds" << endl;
-    }
-
     Encryptor encryptor(context, public_key);
     Decryptor decryptor(context, secret_key);
     Evaluator evaluator(context);
@@ -94,6 +82,7 @@ void* bfv_performance(void *th_para){
         batch_encoder.encode(pod_vector, plain);
         time_end = chrono::high_resolution_clock::now();
         time_batch_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_BATCH, time_start, time_end);
         /*
         [Unbatching]
         We unbatch what we just batched.
@@ -103,6 +92,7 @@ void* bfv_performance(void *th_para){
         batch_encoder.decode(plain, pod_vector2);
         time_end = chrono::high_resolution_clock::now();
         time_unbatch_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_UNBATCH, time_start, time_end);
         if (pod_vector2 != pod_vector)
         {
             throw runtime_error("Batch/unbatch failed. Something is wrong.");
@@ -119,6 +109,19 @@ void* bfv_performance(void *th_para){
         encryptor.encrypt(plain, encrypted);
         time_end = chrono::high_resolution_clock::now();
         time_encrypt_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_ENCRYPT, time_start, time_end);
+
+        /*
+        [Exchange]
+        In the multi-process runner we hand the fresh ciphertext to the next
+        worker through shared memory and add whatever our neighbour sent us.
+        */
+        if (para->link != NULL){
+            time_start = chrono::high_resolution_clock::now();
+            shard_exchange(para->link, encrypted, evaluator);
+            time_end = chrono::high_resolution_clock::now();
+            bench_record(para, BENCH_EXCHANGE, time_start, time_end);
+        }
 
         /*
         [Decryption]
@@ -129,6 +132,7 @@ void* bfv_performance(void *th_para){
         decryptor.decrypt(encrypted, plain2);
         time_end = chrono::high_resolution_clock::now();
         time_decrypt_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_DECRYPT, time_start, time_end);
         if (plain2 != plain){
             throw runtime_error("Encrypt/decrypt failed. Something is wrong.");
         }
@@ -147,6 +151,7 @@ void* bfv_performance(void *th_para){
         // evaluator.add_inplace(encrypted1, encrypted2);
         time_end = chrono::high_resolution_clock::now();
         time_add_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_ADD, time_start, time_end);
 
         /*
         [Multiply]
@@ -159,6 +164,7 @@ void* bfv_performance(void *th_para){
         evaluator.multiply_inplace(encrypted1, encrypted2);
         time_end = chrono::high_resolution_clock::now();
         time_multiply_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_MULTIPLY, time_start, time_end);
 
         /*
         [Multiply Plain]
@@ -170,6 +176,7 @@ void* bfv_performance(void *th_para){
         evaluator.multiply_plain_inplace(encrypted2, plain);
         time_end = chrono::high_resolution_clock::now();
         time_multiply_plain_sum += chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_MULTIPLY_PLAIN, time_start, time_end);
 
         /*
         [Square]
@@ -181,6 +188,7 @@ void* bfv_performance(void *th_para){
         time_end = chrono::high_resolution_clock::now();
         time_square_sum += chrono::duration_cast<
             chrono::microseconds>(time_end - time_start);
+        bench_record(para, BENCH_SQUARE, time_start, time_end);
 
         if (context->using_keyswitching())
         {
@@ -196,6 +204,7 @@ void* bfv_performance(void *th_para){
             time_end = chrono::high_resolution_clock::now();
             time_relinearize_sum += chrono::duration_cast<
                 chrono::microseconds>(time_end - time_start);
+            bench_record(para, BENCH_RELINEARIZE, time_start, time_end);
 
             /*
             [Rotate Rows One Step]
@@ -207,6 +216,7 @@ void* bfv_performance(void *th_para){
             time_end = chrono::high_resolution_clock::now();
             time_rotate_rows_one_step_sum += chrono::duration_cast<
                 chrono::microseconds>(time_end - time_start);;
+            bench_record(para, BENCH_ROTATE_ROWS_ONE_STEP, time_start, time_end);
 
             /*
             [Rotate Rows Random]
@@ -220,6 +230,7 @@ void* bfv_performance(void *th_para){
             time_end = chrono::high_resolution_clock::now();
             time_rotate_rows_random_sum += chrono::duration_cast<
                 chrono::microseconds>(time_end - time_start);
+            bench_record(para, BENCH_ROTATE_ROWS_RANDOM, time_start, time_end);
 
             /*
             [Rotate Columns]
@@ -230,16 +241,20 @@ void* bfv_performance(void *th_para){
             time_end = chrono::high_resolution_clock::now();
             time_rotate_columns_sum += chrono::duration_cast<
                 chrono::microseconds>(time_end - time_start);
+            bench_record(para, BENCH_ROTATE_COLUMNS, time_start, time_end);
         }
         time_end_g = chrono::high_resolution_clock::now();
         time_diff_g = chrono::duration_cast<chrono::microseconds>(time_end_g - time_start_g);
         count = count + 1;
-        if (time_diff_g.count() > MAXS) break;
+        if (time_diff_g.count() > para->duration) break;
         /*
         Print a dot to indicate progress.
         */
     }
     LogVVV << "count: " << count << endl;
+    para->count = count;
+    para->loop_time = time_diff_g.count();
+    para->pss = pss_kb();
 
     auto avg_batch = time_batch_sum.count();
     auto avg_unbatch = time_unbatch_sum.count();
@@ -271,15 +286,140 @@ void* bfv_performance(void *th_para){
         LogVVV << "Average rotate columns: " << avg_rotate_columns <<
             " microseconds" << endl;
     }
+}
+
+void* bfv_performance(void *th_para){
+    /* Get the current timestamp
+    */
+    struct thread_para *para = (struct thread_para *) th_para;
+    string path = "../clustar/record/log";
+    path = path + to_string(para->fd);
+    ofstream LogVVV(path);
+    chrono::high_resolution_clock::time_point time_start, time_end;
+    chrono::microseconds time_diff;
+    auto context = para->context;
+    trace_thread_name("bfv_performance " + to_string(para->fd));
+    /* Generating secret/public keys
+    */
+    time_start = chrono::high_resolution_clock::now();
+    KeyGenerator keygen(context);
+    time_end = chrono::high_resolution_clock::now();
+    time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+    LogVVV << "Generate Keys Done: " << time_diff.count() << " microseconds" << endl;
+    bench_record(para, BENCH_KEYGEN, time_start, time_end);
+    auto secret_key = keygen.secret_key();
+    auto public_key = keygen.public_key();
+    RelinKeys relin_keys;
+    GaloisKeys gal_keys;
+    if (context->using_keyswitching()){
+        /* Generate relinearization keys
+        */
+        time_start = chrono::high_resolution_clock::now();
+        relin_keys = keygen.relin_keys();
+        time_end = chrono::high_resolution_clock::now();
+        time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        LogVVV << "Generate Relinearization Keys Done: " << time_diff.count() << " microseconds" << endl;
+        bench_record(para, BENCH_RELIN_KEYS, time_start, time_end);
+        if (!context->key_context_data()->qualifiers().using_batching){
+            LogVVV << "Given encryption parameters do not support batching." << endl;
+            return NULL;
+        }
+        /* Generating Galois keys
+        */
+        time_start = chrono::high_resolution_clock::now();
+        gal_keys = keygen.galois_keys();
+        time_end = chrono::high_resolution_clock::now();
+        time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start);
+        LogVVV << "Generating Galois Key Done: " << time_diff.count() << " microseconds" << endl;
+        bench_record(para, BENCH_GALOIS_KEYS, time_start, time_end);
+    }
+
+    bfv_op_loop(para, LogVVV, public_key, secret_key, relin_keys, gal_keys);
     LogVVV.close();
     pthread_exit(NULL);
 }
 
+/* Parameters of the multicore benchmark, shared by the thread and process runners
+*/
+EncryptionParameters bfv_parameters(size_t m_degree){
+    EncryptionParameters parms(scheme_type::BFV);
+    parms.set_poly_modulus_degree(m_degree);
+    parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_degree));
+    if (m_degree == 1024){
+        parms.set_plain_modulus(12289);
+    }else{
+        parms.set_plain_modulus(786433);
+    }
+    return parms;
+}
+
+/* Runs cpu_core_num bfv_performance threads for duration microseconds each and
+   merges their per-op statistics. The logs go to clustar/record as before.
+   summary, when given, receives the slowest thread's key generation time, the
+   largest PSS in kB sampled by a thread at the end of its loop and the summed
+   iterations per second over each thread's measured loop time.
+*/
+void run_bfv_threads(int cpu_core_num, size_t m_degree, long long duration, map<string, op_stats> &stats, long long &count, struct bench_summary *summary){
+    mkdir("../clustar/record", 0755);
+    /*Initialized thread data 
+    */
+    pthread_t thread[cpu_core_num];
+    struct thread_para th_para[cpu_core_num];
+    EncryptionParameters parms = bfv_parameters(m_degree);
+    for (int i = 0; i < cpu_core_num; i ++){
+        // th_para[i].poly_degree = m_degree;
+        th_para[i].fd = i;
+        th_para[i].context = SEALContext::Create(parms);
+        th_para[i].duration = duration;
+        th_para[i].count = 0;
+        th_para[i].loop_time = 0;
+        th_para[i].pss = 0;
+        th_para[i].link = NULL;
+    }
+    /*Create Thread
+    */
+    for (int i = 0; i < cpu_core_num; i ++){
+        pthread_create(&thread[i], NULL, bfv_performance, (void*)(&th_para[i]));
+    }
+    /*Join
+    */
+    for (int i = 0; i < cpu_core_num; i ++){
+        pthread_join(thread[i], NULL);
+    }
+    /*Merge per-thread statistics
+    */
+    stats.clear();
+    count = 0;
+    if (summary != NULL) *summary = {};
+    for (int i = 0; i < cpu_core_num; i ++){
+        count += th_para[i].count;
+        if (summary != NULL){
+            op_stats *key_stats = th_para[i].stats;
+            double key_time = key_stats[BENCH_KEYGEN].n * key_stats[BENCH_KEYGEN].mean
+                + key_stats[BENCH_RELIN_KEYS].n * key_stats[BENCH_RELIN_KEYS].mean
+                + key_stats[BENCH_GALOIS_KEYS].n * key_stats[BENCH_GALOIS_KEYS].mean;
+            summary->setup_time = max(summary->setup_time, (long long)key_time);
+            summary->pss = max(summary->pss, th_para[i].pss);
+            if (th_para[i].loop_time > 0){
+                summary->rate += th_para[i].count * 1e6 / th_para[i].loop_time;
+            }
+        }
+        for (int op = 0; op < BENCH_OP_NUM; op ++){
+            if (th_para[i].stats[op].n > 0){
+                stats[bench_op_names[op]].merge(th_para[i].stats[op]);
+            }
+        }
+    }
+    trace_dump();
+    system("python3 ../clustar/logAn.py");
+}
+
 int muti_core_runner(){
     /*
     */
     bool invalid = true;
     int cpu_core_num = 40;
+    int mode = 1;
     size_t m_degree = 1024;
     vector<int> valid_degree = {1024, 2048, 4096, 8192, 16384, 32768};
     do{
@@ -296,34 +436,15 @@ int muti_core_runner(){
             invalid = false;
             continue;
         }
-        /*Initialized thread data 
-        */
-        pthread_t thread[cpu_core_num];
-        struct thread_para th_para[cpu_core_num];
-        EncryptionParameters parms(scheme_type::BFV);
-        parms.set_poly_modulus_degree(m_degree);
-        parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_degree));
-        if (m_degree == 1024){
-            parms.set_plain_modulus(12289);
+        cout << endl << ">Enter Runner Mode 1 (threads), 2 (processes) or 3 (compare both):";
+        while (!(cin >> mode) || (mode < 1 || mode > 3));
+        if (mode == 1){
+            map<string, op_stats> stats;
+            long long count;
+            run_bfv_threads(cpu_core_num, m_degree, MAXS, stats, count);
         }else{
-            parms.set_plain_modulus(786433);
-        }
-        for (int i = 0; i < cpu_core_num; i ++){
-            // th_para[i].poly_degree = m_degree;
-            th_para[i].fd = i;
-            th_para[i].context = SEALContext::Create(parms);
-        }
-        /*Create Thread
-        */
-        for (int i = 0; i < cpu_core_num; i ++){
-            pthread_create(&thread[i], NULL, bfv_performance, (void*)(&th_para[i]));
-        }
-        /*Join
-        */
-        for (int i = 0; i < cpu_core_num; i ++){
-            pthread_join(thread[i], NULL);
+            shard_runner(cpu_core_num, m_degree, MAXS, mode == 3);
         }
-        system("python3 ../clustar/logAn.py");
         cout << endl << "Done, Check the report.txt in clustar/record" << endl << endl;
     }while (invalid);
     return 0;
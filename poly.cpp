@@ -0,0 +1,387 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+
+#define POLY_PLAIN_BITS 20
+
+/* Cache of encrypted powers base^1 ... base^n. A power p is always built as
+   base^ceil(p/2) * base^floor(p/2), so its multiplicative depth is ceil(log2 p)
+   and every power costs exactly one ciphertext-ciphertext multiply. Powers of
+   the same depth only depend on lower levels and are computed in parallel.
+*/
+class power_cache{
+public:
+    power_cache(const Evaluator &evaluator, const RelinKeys &relin_keys, const Ciphertext &base, int thread_num)
+        : evaluator_(evaluator), relin_keys_(relin_keys), thread_num_(thread_num), mults(0), relins(0){
+        cache_[1] = base;
+    }
+
+    static int depth(int power){
+        int d = 0;
+        while ((1 << d) < power) d++;
+        return d;
+    }
+
+    /* Number of multiplies needed to make every power in targets available
+    */
+    static size_t cost(const vector<int> &targets){
+        set<int> closure;
+        for (int p : targets) close(p, closure);
+        return closure.size() - (closure.count(1) ? 1 : 0);
+    }
+
+    void prepare(const vector<int> &targets);
+
+    const Ciphertext &get(int power) const{
+        return cache_.at(power);
+    }
+
+    void compute(int power){
+        const Ciphertext &lo = cache_.at(power / 2);
+        const Ciphertext &hi = cache_.at((power + 1) / 2);
+        Ciphertext &dst = cache_.at(power);
+        if (power % 2 == 0){
+            evaluator_.square(lo, dst);
+        }else{
+            evaluator_.multiply(hi, lo, dst);
+        }
+        evaluator_.relinearize_inplace(dst, relin_keys_);
+    }
+
+private:
+    static void close(int power, set<int> &closure){
+        if (power < 1 || closure.count(power)) return;
+        closure.insert(power);
+        if (power == 1) return;
+        close(power / 2, closure);
+        close((power + 1) / 2, closure);
+    }
+
+    const Evaluator &evaluator_;
+    const RelinKeys &relin_keys_;
+    int thread_num_;
+    map<int, Ciphertext> cache_;
+
+public:
+    size_t mults;
+    size_t relins;
+};
+
+struct power_para{
+    power_cache *cache;
+    vector<int> powers;
+};
+
+void* power_worker(void *th_para){
+    struct power_para *para = (struct power_para *) th_para;
+    for (int p : para->powers){
+        para->cache->compute(p);
+    }
+    return NULL;
+}
+
+void power_cache::prepare(const vector<int> &targets){
+    set<int> closure;
+    for (int p : targets) close(p, closure);
+    /* Insert every slot up front so the workers never modify the map itself
+    */
+    map<int, vector<int>> levels;
+    for (int p : closure){
+        if (cache_.count(p)) continue;
+        cache_[p] = Ciphertext();
+        levels[depth(p)].push_back(p);
+    }
+    for (auto &level : levels){
+        vector<int> &powers = level.second;
+        int worker_num = min<int>(thread_num_, powers.size());
+        vector<power_para> th_para(worker_num);
+        pthread_t thread[worker_num];
+        for (size_t i = 0; i < powers.size(); i++){
+            th_para[i % worker_num].cache = this;
+            th_para[i % worker_num].powers.push_back(powers[i]);
+        }
+        for (int i = 0; i < worker_num; i++){
+            pthread_create(&thread[i], NULL, power_worker, (void*)(&th_para[i]));
+        }
+        for (int i = 0; i < worker_num; i++){
+            pthread_join(thread[i], NULL);
+        }
+        mults += powers.size();
+        relins += powers.size();
+    }
+}
+
+struct poly_plan{
+    string name;
+    int baby_step;          // Paterson-Stockmeyer block size, 0 otherwise
+    size_t mults;
+    size_t relins;
+    int depth;
+};
+
+static vector<int> power_range(int lo, int hi){
+    vector<int> powers;
+    for (int i = lo; i <= hi; i++) powers.push_back(i);
+    return powers;
+}
+
+static poly_plan plan_horner(int degree){
+    return {"Horner", 0, (size_t)degree - 1, (size_t)degree - 1, degree - 1};
+}
+
+static poly_plan plan_power_tree(int degree){
+    size_t mults = power_cache::cost(power_range(1, degree));
+    return {"Power Tree", 0, mults, mults, power_cache::depth(degree)};
+}
+
+/* p(x) = sum_j q_j(x) * (x^k)^j with deg q_j < k. The baby powers x^1..x^k and
+   the giant powers y^1..y^(m-1) of y = x^k come from two caches, the block
+   products are summed before a single relinearization. When k divides the
+   degree the last block is the constant a_d, which only needs a plain multiply
+   of y^(m-1), so there is one ciphertext multiply less.
+*/
+static poly_plan plan_paterson_stockmeyer(int degree, int k){
+    int m = (degree + k) / k;
+    int products = degree % k == 0 ? m - 2 : m - 1;
+    size_t baby = power_cache::cost(power_range(1, k));
+    size_t giant = power_cache::cost(power_range(1, m - 1));
+    size_t mults = baby + giant + products;
+    size_t relins = baby + giant + (products > 0 ? 1 : 0);
+    int depth = power_cache::depth(k);
+    if (degree % k == 0){
+        depth += power_cache::depth(m - 1);
+    }
+    if (products > 0){
+        depth = max(depth, power_cache::depth(k) + power_cache::depth(products) + 1);
+    }
+    return {"Paterson-Stockmeyer (k=" + to_string(k) + ")", k, mults, relins, depth};
+}
+
+/* Fewest ciphertext multiplies within the depth budget, ties go to the
+   shallower plan. Falls back to the shallowest plan if none fits.
+*/
+static poly_plan choose_plan(const vector<poly_plan> &plans, int depth_budget){
+    const poly_plan *best = NULL;
+    for (auto &plan : plans){
+        if (plan.depth > depth_budget) continue;
+        if (!best || plan.mults < best->mults || (plan.mults == best->mults && plan.depth < best->depth)){
+            best = &plan;
+        }
+    }
+    if (best) return *best;
+    best = &plans[0];
+    for (auto &plan : plans){
+        if (plan.depth < best->depth) best = &plan;
+    }
+    return *best;
+}
+
+static Plaintext scalar_plain(uint64_t value){
+    Plaintext plain(1);
+    plain[0] = value;
+    return plain;
+}
+
+static Ciphertext eval_horner(const Evaluator &evaluator, const RelinKeys &relin_keys, const Ciphertext &x, const vector<uint64_t> &coeffs, poly_plan &plan){
+    int degree = coeffs.size() - 1;
+    Ciphertext acc;
+    evaluator.multiply_plain(x, scalar_plain(coeffs[degree]), acc);
+    plan.mults = plan.relins = 0;
+    for (int i = degree - 1; i >= 1; i--){
+        evaluator.add_plain_inplace(acc, scalar_plain(coeffs[i]));
+        evaluator.multiply_inplace(acc, x);
+        evaluator.relinearize_inplace(acc, relin_keys);
+        plan.mults++;
+        plan.relins++;
+    }
+    evaluator.add_plain_inplace(acc, scalar_plain(coeffs[0]));
+    return acc;
+}
+
+/* sum_{i=lo}^{hi} coeffs[i] * x^(i - lo), false if no encrypted term is present
+*/
+static bool linear_combination(const Evaluator &evaluator, const power_cache &powers, const vector<uint64_t> &coeffs, int lo, int hi, Ciphertext &dst){
+    bool has_term = false;
+    for (int i = lo + 1; i <= hi; i++){
+        if (coeffs[i] == 0) continue;
+        Ciphertext term;
+        evaluator.multiply_plain(powers.get(i - lo), scalar_plain(coeffs[i]), term);
+        if (has_term){
+            evaluator.add_inplace(dst, term);
+        }else{
+            dst = term;
+            has_term = true;
+        }
+    }
+    if (has_term){
+        evaluator.add_plain_inplace(dst, scalar_plain(coeffs[lo]));
+    }
+    return has_term;
+}
+
+static Ciphertext eval_power_tree(const Evaluator &evaluator, const RelinKeys &relin_keys, const Ciphertext &x, const vector<uint64_t> &coeffs, int thread_num, poly_plan &plan){
+    int degree = coeffs.size() - 1;
+    power_cache powers(evaluator, relin_keys, x, thread_num);
+    powers.prepare(power_range(1, degree));
+    Ciphertext result;
+    linear_combination(evaluator, powers, coeffs, 0, degree, result);
+    plan.mults = powers.mults;
+    plan.relins = powers.relins;
+    return result;
+}
+
+static Ciphertext eval_paterson_stockmeyer(const Evaluator &evaluator, const RelinKeys &relin_keys, const Ciphertext &x, const vector<uint64_t> &coeffs, int thread_num, poly_plan &plan){
+    int degree = coeffs.size() - 1;
+    int k = plan.baby_step;
+    int m = (degree + k) / k;
+    power_cache baby(evaluator, relin_keys, x, thread_num);
+    baby.prepare(power_range(1, k));
+    power_cache giant(evaluator, relin_keys, baby.get(k), thread_num);
+    giant.prepare(power_range(1, m - 1));
+
+    Ciphertext result;
+    bool has_result = false;
+    uint64_t constant_term = 0;
+    size_t block_mults = 0;
+    for (int j = 0; j < m; j++){
+        int lo = j * k;
+        int hi = min(lo + k - 1, degree);
+        Ciphertext block;
+        if (!linear_combination(evaluator, baby, coeffs, lo, hi, block)){
+            /* Constant block, only a plain multiply of the giant power
+            */
+            if (j == 0){
+                constant_term = coeffs[0];
+                continue;
+            }
+            if (coeffs[lo] == 0) continue;
+            evaluator.multiply_plain(giant.get(j), scalar_plain(coeffs[lo]), block);
+        }else if (j > 0){
+            evaluator.multiply_inplace(block, giant.get(j));
+            block_mults++;
+        }
+        if (has_result){
+            evaluator.add_inplace(result, block);
+        }else{
+            result = block;
+            has_result = true;
+        }
+    }
+    /* Lazy relinearization of the summed size-3 block products
+    */
+    if (block_mults > 0){
+        evaluator.relinearize_inplace(result, relin_keys);
+    }
+    evaluator.add_plain_inplace(result, scalar_plain(constant_term));
+    plan.mults = baby.mults + giant.mults + block_mults;
+    plan.relins = baby.relins + giant.relins + (block_mults > 0 ? 1 : 0);
+    return result;
+}
+
+int poly_runner(){
+    bool invalid = true;
+    int degree = 8, depth_budget = 6, thread_num = 4;
+    size_t m_degree = 16384;
+    vector<int> valid_degree = {8192, 16384, 32768};
+    do{
+        cout << "+---------------------------------------------------------+" << endl;
+        cout << "| Polynomial Evaluation                                   |" << endl;
+        cout << "+---------------------------------------------------------+" << endl;
+        cout << endl << ">Enter Polynomial Degree (8 ~ 64) or exit (0):";
+        while (!(cin >> degree) || (degree != 0 && (degree < 8 || degree > 64)));
+        if (degree == 0){invalid = false; continue;}
+        cout << endl << ">Enter Depth Budget (1 ~ 64):";
+        while (!(cin >> depth_budget) || (depth_budget < 1 || depth_budget > 64));
+        cout << endl << ">Enter Number of Threads (1 ~ 40):";
+        while (!(cin >> thread_num) || (thread_num < 1 || thread_num > 40));
+        cout << endl << ">Enter poly_modulus_degree 8192, 16384 or 32768:";
+        while (!(cin >> m_degree));
+        if (find(valid_degree.begin(), valid_degree.end(), m_degree) == valid_degree.end()){
+            cout << "Invalid poly_modulus_degree" << endl;
+            invalid = false;
+            continue;
+        }
+        EncryptionParameters parms(scheme_type::BFV);
+        parms.set_poly_modulus_degree(m_degree);
+        parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_degree));
+        parms.set_plain_modulus(PlainModulus::Batching(m_degree, POLY_PLAIN_BITS));
+        auto context = SEALContext::Create(parms);
+        uint64_t plain_modulus = parms.plain_modulus().value();
+
+        KeyGenerator keygen(context);
+        PublicKey public_key = keygen.public_key();
+        SecretKey secret_key = keygen.secret_key();
+        RelinKeys relin_keys = keygen.relin_keys();
+        Encryptor encryptor(context, public_key);
+        Evaluator evaluator(context);
+        Decryptor decryptor(context, secret_key);
+        BatchEncoder batch_encoder(context);
+
+        /*Nonzero coefficients and one x per slot, checked against plain Horner
+        */
+        vector<uint64_t> coeffs(degree + 1);
+        for (int i = 0; i <= degree; i++){
+            coeffs[i] = (i * 7919 + 1) % plain_modulus;
+            if (coeffs[i] == 0) coeffs[i] = 1;
+        }
+        size_t slot_count = batch_encoder.slot_count();
+        vector<uint64_t> x_vector(slot_count), expected(slot_count);
+        for (size_t s = 0; s < slot_count; s++){
+            x_vector[s] = (s % 1024) + 1;
+            uint64_t acc = 0;
+            for (int i = degree; i >= 0; i--){
+                acc = (acc * x_vector[s] + coeffs[i]) % plain_modulus;
+            }
+            expected[s] = acc;
+        }
+        Plaintext x_plain;
+        batch_encoder.encode(x_vector, x_plain);
+        Ciphertext x_encrypted;
+        encryptor.encrypt(x_plain, x_encrypted);
+
+        vector<poly_plan> plans = {plan_horner(degree), plan_power_tree(degree)};
+        for (int k = 2; k <= degree; k++){
+            plans.push_back(plan_paterson_stockmeyer(degree, k));
+        }
+        poly_plan chosen = choose_plan(plans, depth_budget);
+        /*Run Horner, the power tree and the cheapest Paterson-Stockmeyer split
+        */
+        vector<poly_plan> ps_plans(plans.begin() + 2, plans.end());
+        vector<poly_plan> runs = {plans[0], plans[1], chosen.baby_step ? chosen : choose_plan(ps_plans, depth_budget)};
+
+        fprintf(stdout, "+----------------------------------------------------------------------------------------------------+\n");
+        fprintf(stdout, "| Degree %-3d  Depth Budget %-3d  Threads %-3d  poly_modulus_degree %-6lu  plain_modulus %-13lu |\n",
+            degree, depth_budget, thread_num, m_degree, plain_modulus);
+        fprintf(stdout, "+----------------------------------------------------------------------------------------------------+\n");
+        fprintf(stdout, "| Strategy                    | Est Mul | Mul   | Relin | Depth | Time(us)     | Noise | Correct | * |\n");
+        fprintf(stdout, "+----------------------------------------------------------------------------------------------------+\n");
+        for (auto &plan : runs){
+            poly_plan stats = plan;
+            chrono::high_resolution_clock::time_point time_start, time_end;
+            Ciphertext result;
+            time_start = chrono::high_resolution_clock::now();
+            if (plan.baby_step){
+                result = eval_paterson_stockmeyer(evaluator, relin_keys, x_encrypted, coeffs, thread_num, stats);
+            }else if (plan.name == "Horner"){
+                result = eval_horner(evaluator, relin_keys, x_encrypted, coeffs, stats);
+            }else{
+                result = eval_power_tree(evaluator, relin_keys, x_encrypted, coeffs, thread_num, stats);
+            }
+            time_end = chrono::high_resolution_clock::now();
+            size_t time_diff = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+            int noise_budget = decryptor.invariant_noise_budget(result);
+            Plaintext res_plain;
+            vector<uint64_t> res_vector(slot_count);
+            decryptor.decrypt(result, res_plain);
+            batch_encoder.decode(res_plain, res_vector);
+            fprintf(stdout, "| %-27s | %-7lu | %-5lu | %-5lu | %-5d | %-12lu | %-5d | %-7s | %s |\n",
+                plan.name.c_str(), plan.mults, stats.mults, stats.relins, plan.depth, time_diff, noise_budget,
+                res_vector == expected ? "Yes" : "No", plan.name == chosen.name ? "*" : " ");
+            fprintf(stdout, "+----------------------------------------------------------------------------------------------------+\n");
+        }
+        fprintf(stdout, "\n");
+    }while (invalid);
+    return 0;
+}
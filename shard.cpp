@@ -0,0 +1,429 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <signal.h>
+#include <sstream>
+#include <streambuf>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SHARD_SLOTS 2
+#define SHARD_ALIGN 64
+
+/* Single-producer single-consumer ring in shared memory. Worker i is the only
+   producer of ring i and worker i + 1 its only consumer. A slot holds the size
+   of a ciphertext followed by its raw RNS coefficients, copied as they are
+   without going through SEAL serialization.
+*/
+struct shard_ring{
+    atomic<unsigned long long> head;
+    char pad_head[SHARD_ALIGN - sizeof(atomic<unsigned long long>)];
+    atomic<unsigned long long> tail;
+    char pad_tail[SHARD_ALIGN - sizeof(atomic<unsigned long long>)];
+};
+
+struct shard_link{
+    shared_ptr<SEALContext> context;
+    shard_ring *outbox;
+    shard_ring *inbox;
+    size_t slot_bytes;
+    long long sent;
+    long long received;
+};
+
+/* What a worker process sends back to the parent over its pipe
+*/
+struct shard_report{
+    long long count;
+    long long loop_time;
+    long long load_time;
+    long long sent;
+    long long received;
+    long long pss;
+    op_stats stats[BENCH_OP_NUM];
+};
+
+struct shard_result{
+    bool reported;
+    long long count;
+    double rate;
+    long long wall_time;
+    long long setup_time;
+    long long pss;
+    long long sent;
+    long long received;
+    size_t segment_bytes;
+};
+
+/* Lets SEAL load keys straight out of the shared segment
+*/
+struct shard_streambuf : public streambuf{
+    shard_streambuf(char *begin, size_t size){
+        setg(begin, begin, begin + size);
+    }
+};
+
+static size_t shard_align(size_t bytes){
+    return (bytes + SHARD_ALIGN - 1) / SHARD_ALIGN * SHARD_ALIGN;
+}
+
+static char *shard_slot(shard_ring *ring, size_t slot_bytes, unsigned long long index){
+    return (char *)(ring + 1) + (index % SHARD_SLOTS) * slot_bytes;
+}
+
+void shard_exchange(struct shard_link *link, const Ciphertext &encrypted, const Evaluator &evaluator){
+    size_t data_bytes = encrypted.uint64_count() * sizeof(uint64_t);
+    uint64_t size = encrypted.size();
+
+    /*Push, a full ring just skips this round instead of blocking
+    */
+    shard_ring *outbox = link->outbox;
+    unsigned long long head = outbox->head.load(memory_order_relaxed);
+    if (head - outbox->tail.load(memory_order_acquire) < SHARD_SLOTS && data_bytes + sizeof(uint64_t) <= link->slot_bytes){
+        char *slot = shard_slot(outbox, link->slot_bytes, head);
+        memcpy(slot, &size, sizeof(uint64_t));
+        memcpy(slot + sizeof(uint64_t), encrypted.data(), data_bytes);
+        outbox->head.store(head + 1, memory_order_release);
+        link->sent++;
+    }
+
+    /*Pop and fold the neighbour's ciphertext into a copy of ours
+    */
+    shard_ring *inbox = link->inbox;
+    unsigned long long tail = inbox->tail.load(memory_order_relaxed);
+    if (tail != inbox->head.load(memory_order_acquire)){
+        char *slot = shard_slot(inbox, link->slot_bytes, tail);
+        memcpy(&size, slot, sizeof(uint64_t));
+        Ciphertext received;
+        received.resize(link->context, encrypted.parms_id(), size);
+        memcpy(received.data(), slot + sizeof(uint64_t), received.uint64_count() * sizeof(uint64_t));
+        inbox->tail.store(tail + 1, memory_order_release);
+        evaluator.add_inplace(received, encrypted);
+        link->received++;
+    }
+}
+
+static bool read_full(int fd, void *data, size_t size){
+    char *ptr = (char *)data;
+    while (size > 0){
+        ssize_t n = read(fd, ptr, size);
+        if (n <= 0) return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size){
+    const char *ptr = (const char *)data;
+    while (size > 0){
+        ssize_t n = write(fd, ptr, size);
+        if (n <= 0) return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Returns whether the report reached the parent
+*/
+static bool shard_worker(int id, int workers, char *segment, size_t key_bytes, size_t ring_bytes, size_t slot_bytes, const EncryptionParameters &parms, long long duration, int fd){
+    chrono::high_resolution_clock::time_point time_start, time_end;
+    struct thread_para para;
+    para.fd = id;
+    para.context = SEALContext::Create(parms);
+    para.duration = duration;
+    para.count = 0;
+    para.loop_time = 0;
+    para.pss = 0;
+    auto context = para.context;
+    trace_thread_name("shard worker " + to_string(id));
+
+    /*Load the parent's keys from the shared segment
+    */
+    time_start = chrono::high_resolution_clock::now();
+    shard_streambuf buf(segment, key_bytes);
+    istream in(&buf);
+    PublicKey public_key;
+    SecretKey secret_key;
+    RelinKeys relin_keys;
+    GaloisKeys gal_keys;
+    public_key.load(context, in);
+    secret_key.load(context, in);
+    if (context->using_keyswitching()){
+        relin_keys.load(context, in);
+        gal_keys.load(context, in);
+    }
+    time_end = chrono::high_resolution_clock::now();
+
+    char *rings = segment + shard_align(key_bytes);
+    struct shard_link link;
+    link.context = context;
+    link.outbox = (shard_ring *)(rings + id * ring_bytes);
+    link.inbox = (shard_ring *)(rings + ((id + workers - 1) % workers) * ring_bytes);
+    link.slot_bytes = slot_bytes;
+    link.sent = 0;
+    link.received = 0;
+    para.link = &link;
+
+    string path = "../clustar/record/log";
+    path = path + to_string(id);
+    ofstream LogVVV(path);
+    bfv_op_loop(&para, LogVVV, public_key, secret_key, relin_keys, gal_keys);
+    LogVVV.close();
+
+    struct shard_report report;
+    report.count = para.count;
+    report.loop_time = para.loop_time;
+    report.load_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+    report.sent = link.sent;
+    report.received = link.received;
+    report.pss = para.pss;
+    for (int op = 0; op < BENCH_OP_NUM; op ++){
+        report.stats[op] = para.stats[op];
+    }
+    return write_full(fd, &report, sizeof(report));
+}
+
+/* Kills and reaps the workers forked so far when the launch fails half way
+*/
+static void shard_abort(pid_t *pid, int *pipe_fd, int started, char *segment, size_t segment_bytes){
+    for (int i = 0; i < started; i ++){
+        kill(pid[i], SIGKILL);
+        close(pipe_fd[i]);
+        waitpid(pid[i], NULL, 0);
+    }
+    munmap(segment, segment_bytes);
+}
+
+/* Forks cpu_core_num worker processes. The parent generates the keys once, with
+   the Galois and relinearization keys built on the keygen pool, and places them
+   in an anonymous shared mapping that every worker inherits, next to one
+   ciphertext ring per worker. With CLUSTAR_TRACE set, the parent's key
+   generation goes to <path>.keygen and worker i writes its own <path>.<i>.
+*/
+static shard_result run_bfv_processes(int cpu_core_num, size_t m_degree, long long duration, map<string, op_stats> &stats){
+    chrono::high_resolution_clock::time_point time_start, time_end, wall_start;
+    shard_result result = {};
+    mkdir("../clustar/record", 0755);
+    wall_start = chrono::high_resolution_clock::now();
+    EncryptionParameters parms = bfv_parameters(m_degree);
+    auto context = SEALContext::Create(parms);
+
+    time_start = chrono::high_resolution_clock::now();
+    KeyGenerator keygen(context);
+    stringstream keys;
+    keygen.public_key().save(keys, compr_mode_type::none);
+    keygen.secret_key().save(keys, compr_mode_type::none);
+    if (context->using_keyswitching()){
+        RelinKeys relin_keys;
+        GaloisKeys gal_keys;
+        parallel_keygen(context, keygen.secret_key(), keygen.public_key(), cpu_core_num, relin_keys, gal_keys);
+        relin_keys.save(keys, compr_mode_type::none);
+        gal_keys.save(keys, compr_mode_type::none);
+    }
+    string key_data = keys.str();
+    time_end = chrono::high_resolution_clock::now();
+    long long keygen_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+    /*Flush the keygen events so the workers do not inherit them at fork
+    */
+    trace_dump(".keygen");
+
+    /*A fresh ciphertext has two polynomials over the first data level
+    */
+    size_t coeff_mod_count = context->first_context_data()->parms().coeff_modulus().size();
+    size_t slot_bytes = shard_align(sizeof(uint64_t) * (1 + 2 * coeff_mod_count * m_degree));
+    size_t ring_bytes = shard_align(sizeof(shard_ring) + SHARD_SLOTS * slot_bytes);
+    size_t segment_bytes = shard_align(key_data.size()) + cpu_core_num * ring_bytes;
+    char *segment = (char *)mmap(NULL, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        throw runtime_error("Cannot map the shared memory segment");
+    }
+    memcpy(segment, key_data.data(), key_data.size());
+    for (int i = 0; i < cpu_core_num; i ++){
+        shard_ring *ring = (shard_ring *)(segment + shard_align(key_data.size()) + i * ring_bytes);
+        new (ring) shard_ring;
+        ring->head.store(0);
+        ring->tail.store(0);
+    }
+
+    /*Fork the workers, each reports over its own pipe
+    */
+    pid_t pid[cpu_core_num];
+    int pipe_fd[cpu_core_num];
+    cout.flush();
+    for (int i = 0; i < cpu_core_num; i ++){
+        int fds[2];
+        if (pipe(fds) != 0){
+            shard_abort(pid, pipe_fd, i, segment, segment_bytes);
+            throw runtime_error("Cannot create the stats pipe");
+        }
+        pid[i] = fork();
+        if (pid[i] < 0){
+            close(fds[0]);
+            close(fds[1]);
+            shard_abort(pid, pipe_fd, i, segment, segment_bytes);
+            throw runtime_error("Cannot fork worker " + to_string(i));
+        }
+        if (pid[i] == 0){
+            close(fds[0]);
+            bool reported = shard_worker(i, cpu_core_num, segment, key_data.size(), ring_bytes, slot_bytes, parms, duration, fds[1]);
+            close(fds[1]);
+            trace_dump("." + to_string(i));
+            _exit(reported ? 0 : 1);
+        }
+        close(fds[1]);
+        pipe_fd[i] = fds[0];
+    }
+
+    /*Collect the reports, then reap the workers
+    */
+    stats.clear();
+    result.reported = true;
+    long long load_time = 0;
+    for (int i = 0; i < cpu_core_num; i ++){
+        struct shard_report report;
+        if (read_full(pipe_fd[i], &report, sizeof(report))){
+            result.count += report.count;
+            result.sent += report.sent;
+            result.received += report.received;
+            result.pss += report.pss;
+            /*Threads have no exchange, so it is left out of the measured loop time
+            */
+            const op_stats &exchange = report.stats[BENCH_EXCHANGE];
+            double busy = report.loop_time - exchange.n * exchange.mean;
+            if (busy > 0){
+                result.rate += report.count * 1e6 / busy;
+            }
+            load_time = max(load_time, report.load_time);
+            for (int op = 0; op < BENCH_OP_NUM; op ++){
+                if (report.stats[op].n > 0){
+                    stats[bench_op_names[op]].merge(report.stats[op]);
+                }
+            }
+        }else{
+            cout << "Worker " << i << " did not report" << endl;
+            result.reported = false;
+        }
+        close(pipe_fd[i]);
+        int status;
+        waitpid(pid[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            cout << "Worker " << i << " exited abnormally" << endl;
+            result.reported = false;
+        }
+    }
+    time_end = chrono::high_resolution_clock::now();
+    munmap(segment, segment_bytes);
+
+    result.wall_time = chrono::duration_cast<chrono::microseconds>(time_end - wall_start).count();
+    result.setup_time = keygen_time + load_time;
+    result.segment_bytes = segment_bytes;
+    system("python3 ../clustar/logAn.py");
+    return result;
+}
+
+/* Runs the threaded benchmark in a child process so that its memory can be
+   compared with the worker processes. The child still inherits the pages of
+   this session at fork, PSS only counts its share of them.
+*/
+static shard_result run_bfv_threads_isolated(int cpu_core_num, size_t m_degree, long long duration){
+    shard_result result = {};
+    int fds[2];
+    if (pipe(fds) != 0){
+        throw runtime_error("Cannot create the stats pipe");
+    }
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0){
+        close(fds[0]);
+        close(fds[1]);
+        throw runtime_error("Cannot fork the threaded benchmark");
+    }
+    if (pid == 0){
+        close(fds[0]);
+        chrono::high_resolution_clock::time_point time_start, time_end;
+        map<string, op_stats> stats;
+        time_start = chrono::high_resolution_clock::now();
+        /*Threads generate their keys concurrently, the slowest one gates the start
+        */
+        struct bench_summary summary;
+        run_bfv_threads(cpu_core_num, m_degree, duration, stats, result.count, &summary);
+        time_end = chrono::high_resolution_clock::now();
+        result.setup_time = summary.setup_time;
+        result.pss = summary.pss;
+        result.rate = summary.rate;
+        result.wall_time = chrono::duration_cast<chrono::microseconds>(time_end - time_start).count();
+        result.reported = true;
+        bool reported = write_full(fds[1], &result, sizeof(result));
+        close(fds[1]);
+        _exit(reported ? 0 : 1);
+    }
+    close(fds[1]);
+    if (!read_full(fds[0], &result, sizeof(result))){
+        cout << "Threaded run did not report" << endl;
+        result = {};
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        cout << "Threaded run exited abnormally" << endl;
+        result.reported = false;
+    }
+    return result;
+}
+
+static void print_shard_row(const char *mode, int workers, const shard_result &result){
+    if (!result.reported){
+        fprintf(stdout, "| %-10s | %-7d | %-65s |\n", mode, workers, "did not report, see the messages above");
+        fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+        return;
+    }
+    fprintf(stdout, "| %-10s | %-7d | %-10lld | %-12.1f | %-10.1f | %-10.1f | %-11.1f |\n",
+        mode, workers, result.count, result.rate,
+        result.wall_time / 1000.0, result.setup_time / 1000.0, result.pss / 1024.0);
+    fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+}
+
+void shard_runner(int cpu_core_num, size_t m_degree, long long duration, bool compare){
+    shard_result threads = {};
+    if (compare){
+        threads = run_bfv_threads_isolated(cpu_core_num, m_degree, duration);
+        /*Both runs write clustar/record and logAn.py, keep the threaded report apart
+        */
+        rename("../clustar/report.txt", "../clustar/report_threads.txt");
+    }
+    map<string, op_stats> stats;
+    shard_result processes = run_bfv_processes(cpu_core_num, m_degree, duration, stats);
+
+    fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Mode       | Workers | Iterations | Iter/s       | Wall(ms)   | Setup(ms)  | PSS(MB)     |\n");
+    fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+    if (compare){
+        print_shard_row("threads", cpu_core_num, threads);
+    }
+    print_shard_row("processes", cpu_core_num, processes);
+    fprintf(stdout, "| Shared segment %-10.1f MB, ciphertexts sent %-10lld received %-10lld            |\n",
+        processes.segment_bytes / 1048576.0, processes.sent, processes.received);
+    fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+    fprintf(stdout, "| Iter/s is summed over each worker's measured loop time, which can overshoot the duration |\n");
+    fprintf(stdout, "| by up to one iteration. Process Iter/s leaves out the ring exchange, which threads skip. |\n");
+    fprintf(stdout, "| PSS is sampled at the end of each loop: the largest thread sample, the sum over workers. |\n");
+    fprintf(stdout, "| The workers' sum holds their share of the shared segment, and every worker keeps its own |\n");
+    fprintf(stdout, "| deserialized copy of the keys. Both modes include pages inherited from this session.     |\n");
+    fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+    if (stats.count("exchange")){
+        fprintf(stdout, "| Average exchange: %-12.3f microseconds                                              |\n", stats["exchange"].mean);
+        fprintf(stdout, "+------------------------------------------------------------------------------------------+\n");
+    }
+    if (compare){
+        cout << "The threaded report is in clustar/report_threads.txt, the process report in clustar/report.txt" << endl;
+    }
+    fprintf(stdout, "\n");
+}
@@ -0,0 +1,114 @@
+/*
+    Author: Linbin Yang @ Clustar.ai
+*/
+
+#include "common.h"
+#include <atomic>
+#include <cstdlib>
+
+/* Each thread owns one ring buffer and is its only writer, publishing events
+   with a release store of the head counter. Buffers are linked into a global
+   list with a CAS push the first time a thread records, so the hot path never
+   takes a lock. When a buffer wraps the oldest events are overwritten.
+*/
+#define TRACE_CAPACITY (1 << 15)
+
+struct trace_event{
+    const char *name;
+    long long begin;
+    long long end;
+};
+
+struct trace_buffer{
+    int tid;
+    string label;
+    atomic<unsigned long long> head;
+    trace_buffer *next;
+    trace_event events[TRACE_CAPACITY];
+};
+
+static bool trace_on = false;
+static string trace_path;
+static chrono::high_resolution_clock::time_point trace_epoch;
+static atomic<trace_buffer*> trace_list(NULL);
+static atomic<int> trace_tid(0);
+static atomic<int> trace_generation(0);
+static thread_local trace_buffer *trace_local = NULL;
+static thread_local int trace_local_generation = -1;
+
+void trace_init(){
+    const char *path = getenv("CLUSTAR_TRACE");
+    if (path == NULL || *path == '\0') return;
+    trace_on = true;
+    trace_path = path;
+    trace_epoch = chrono::high_resolution_clock::now();
+}
+
+static trace_buffer *trace_buffer_get(){
+    int generation = trace_generation.load(memory_order_acquire);
+    if (trace_local_generation == generation){
+        return trace_local;
+    }
+    trace_buffer *buf = new trace_buffer;
+    buf->tid = ++trace_tid;
+    buf->label = "thread " + to_string(buf->tid);
+    buf->head.store(0, memory_order_relaxed);
+    buf->next = trace_list.load(memory_order_relaxed);
+    while (!trace_list.compare_exchange_weak(buf->next, buf, memory_order_release, memory_order_relaxed));
+    trace_local = buf;
+    trace_local_generation = generation;
+    return buf;
+}
+
+void trace_thread_name(const string &label){
+    if (!trace_on) return;
+    trace_buffer_get()->label = label;
+}
+
+void trace_record(const char *name, chrono::high_resolution_clock::time_point time_start, chrono::high_resolution_clock::time_point time_end){
+    if (!trace_on) return;
+    trace_buffer *buf = trace_buffer_get();
+    unsigned long long head = buf->head.load(memory_order_relaxed);
+    trace_event &event = buf->events[head & (TRACE_CAPACITY - 1)];
+    event.name = name;
+    event.begin = chrono::duration_cast<chrono::nanoseconds>(time_start - trace_epoch).count();
+    event.end = chrono::duration_cast<chrono::nanoseconds>(time_end - trace_epoch).count();
+    buf->head.store(head + 1, memory_order_release);
+}
+
+/* Writes every buffer as Chrome/Perfetto trace JSON to the trace path plus
+   suffix and starts a new generation. Must only be called once the recording
+   threads are joined.
+*/
+void trace_dump(const string &suffix){
+    if (!trace_on) return;
+    string path = trace_path + suffix;
+    FILE *fp = fopen(path.c_str(), "w");
+    if (fp == NULL){
+        cout << "Cannot open trace file " << path << endl;
+        return;
+    }
+    int pid = getpid();
+    bool first = true;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    trace_buffer *buf = trace_list.exchange(NULL, memory_order_acquire);
+    while (buf != NULL){
+        unsigned long long head = buf->head.load(memory_order_acquire);
+        unsigned long long start = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+        fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",", pid, buf->tid, buf->label.c_str());
+        first = false;
+        for (unsigned long long i = start; i < head; i++){
+            trace_event &event = buf->events[i & (TRACE_CAPACITY - 1)];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, pid, buf->tid, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+        }
+        trace_buffer *next = buf->next;
+        delete buf;
+        buf = next;
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    trace_generation++;
+    cout << "Trace written to " << path << endl;
+}